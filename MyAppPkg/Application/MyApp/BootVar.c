@@ -0,0 +1,50 @@
+#include "BootVar.h"
+
+static EFI_GUID BootVarGuid = { 0x6e3f7a2c, 0x41d8, 0x4b9e, { 0x9a, 0x05, 0x3c, 0x71, 0xd2, 0x8e, 0x4f, 0x16 } };
+
+EFI_STATUS BootVarGet(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, OUT VOID* Data, IN UINTN Size){
+    EFI_STATUS Status;
+    UINTN DataSize = Size;
+
+    Status = ST->RuntimeServices->GetVariable(Name, &BootVarGuid, NULL, &DataSize, Data);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    // stale layout from an older loader
+    if(DataSize != Size){
+        return EFI_NOT_FOUND;
+    }
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS BootVarGetPool(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, OUT VOID** Data, OUT UINTN* Size){
+    EFI_STATUS Status;
+
+    *Size = 0;
+    Status = ST->RuntimeServices->GetVariable(Name, &BootVarGuid, NULL, Size, NULL);
+    if(Status != EFI_BUFFER_TOO_SMALL){
+        return EFI_ERROR(Status)? Status : EFI_NOT_FOUND;
+    }
+
+    Status = ST->BootServices->AllocatePool(EfiBootServicesData, *Size, Data);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    Status = ST->RuntimeServices->GetVariable(Name, &BootVarGuid, NULL, Size, *Data);
+    if(EFI_ERROR(Status)){
+        ST->BootServices->FreePool(*Data);
+    }
+
+    return Status;
+}
+
+EFI_STATUS BootVarSet(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, IN VOID* Data, IN UINTN Size){
+    return ST->RuntimeServices->SetVariable(Name, &BootVarGuid, BOOT_VAR_ATTRIBUTES, Size, Data);
+}
+
+EFI_STATUS BootVarDelete(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name){
+    return ST->RuntimeServices->SetVariable(Name, &BootVarGuid, BOOT_VAR_ATTRIBUTES, 0, NULL);
+}
@@ -0,0 +1,29 @@
+#include <Uefi.h>
+
+#define BOOT_VAR_ATTRIBUTES (EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+// Kernel image selection of the last boot
+#define KERNEL_BOOT_VAR L"KernelBoot"
+// Device path of the volume the kernel was loaded from
+#define KERNEL_DEVICE_VAR L"KernelDevice"
+// Handoff paging mode, see Paging.h
+#define HANDOFF_PAGING_VAR L"HandoffPaging"
+// Non zero reuses a resident kernel image on warm reboots
+#define WARM_BOOT_VAR L"WarmBoot"
+// Seconds to wait for a key after a failed boot
+#define KEY_TIMEOUT_VAR L"KeyTimeout"
+
+typedef struct
+{
+    UINT32 Index;       // Index of the image that booted
+    UINT32 FailedMask;  // Images that failed before it
+    UINT32 LastError;   // Status of the last failed image
+} KernelBootRecord;
+
+EFI_STATUS BootVarGet(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, OUT VOID* Data, IN UINTN Size);
+
+EFI_STATUS BootVarGetPool(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, OUT VOID** Data, OUT UINTN* Size);
+
+EFI_STATUS BootVarSet(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name, IN VOID* Data, IN UINTN Size);
+
+EFI_STATUS BootVarDelete(IN EFI_SYSTEM_TABLE* ST, IN CHAR16* Name);
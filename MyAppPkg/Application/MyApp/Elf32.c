@@ -69,14 +69,63 @@ static inline VOID Elf32GetStr(Elf32_Map *map, CHAR8 *file)
     }
 }
 
-BOOLEAN Elf32GetMap(OUT Elf32_Map *map, IN CHAR8 *file)
+static inline BOOLEAN Elf32InFile(UINT64 offset, UINT64 length, UINT32 size)
 {
+    return offset <= size && length <= size - offset;
+}
+
+// every table and loadable segment must lie within the size bytes read
+static BOOLEAN Elf32CheckSegments(Elf32_Map *map, UINT32 size)
+{
+    Elf32_Phdr* phdr = map->phdr;
+    for (UINT32 i = 0; i < map->nphdr; i++)
+    {
+        if(phdr->p_type == PT_LOAD && !Elf32InFile(phdr->p_offset, phdr->p_filesz, size)){
+            return FALSE;
+        }
+        phdr ++ ;
+    }
+    return TRUE;
+}
+
+BOOLEAN Elf32GetMap(OUT Elf32_Map *map, IN CHAR8 *file, IN UINT32 size)
+{
+    UINT32 strndx;
+
+    if(size < sizeof(Elf32_Ehdr)){
+        return FALSE;
+    }
+
     Elf32GetEhdr(map, file);
     if(map->ehdr){
+        map->phdr = 0;
+        map->nphdr = 0;
+        map->str = 0;
+
+        // the first entry holds the extended counts
+        if(map->ehdr->e_shoff && !Elf32InFile(map->ehdr->e_shoff, sizeof(Elf32_Shdr), size)){
+            return FALSE;
+        }
         Elf32GetShdr(map, file);
         if(map->shdr){
+            if(!Elf32InFile(map->ehdr->e_shoff, (UINT64)map->nshdr * sizeof(Elf32_Shdr), size)){
+                return FALSE;
+            }
+
             ELF32GetPhdr(map, file);
+            if(map->phdr && !Elf32InFile(map->ehdr->e_phoff, (UINT64)map->nphdr * sizeof(Elf32_Phdr), size)){
+                return FALSE;
+            }
+
+            strndx = map->ehdr->e_shstrndx != SHN_XINDEX? map->ehdr->e_shstrndx : map->shdr->sh_link;
+            if(strndx != SHN_UNDEF && (strndx >= map->nshdr || !Elf32InFile(map->shdr[strndx].sh_offset, 0, size))){
+                return FALSE;
+            }
             Elf32GetStr(map, file);
+
+            if(!Elf32CheckSegments(map, size)){
+                return FALSE;
+            }
         }
         return TRUE;
     }
@@ -116,7 +165,7 @@ BOOLEAN Elf32LoadFile(IN Elf32_Map* map, IN VOID* offset){
             // copy data
             MemCopy(file + phdr->p_offset, org + phdr->p_vaddr, MIN(phdr->p_memsz, phdr->p_filesz));
             if(phdr->p_memsz > phdr->p_filesz){
-                MemSet(org + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
+                MemSet(org + phdr->p_vaddr + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
             }
         }
         phdr ++ ;
@@ -303,7 +303,7 @@ BOOLEAN Efl32CheckSupported(IN Elf32_Ehdr* ehdr);
 
 BOOLEAN Elf32CheckExecutabel(IN Elf32_Ehdr* ehdr);
 
-BOOLEAN Elf32GetMap(OUT Elf32_Map* map,IN CHAR8* file);
+BOOLEAN Elf32GetMap(OUT Elf32_Map* map,IN CHAR8* file, IN UINT32 size);
 
 CHAR8* Elf32GetStrSection(IN Elf32_Map* map, IN uint32_t shindx);
 
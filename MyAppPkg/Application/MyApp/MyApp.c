@@ -4,93 +4,353 @@
 #include <Library/UefiApplicationEntryPoint.h>
 #include <Protocol/SimpleFileSystem.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/IoLib.h>
+#include <Guid/FileInfo.h>
 
 #include "Elf32.h"
 #include "Info.h"
+#include "BootVar.h"
+#include "Volume.h"
+#include "Paging.h"
+#include "Resident.h"
 
 #define FILE_NPAGES 64
 #define LOADER_GUID 0x12345678
+#define KEY_TIMEOUT_SECONDS 10
+#define KEY_TIMEOUT_INFINITE 0xFFFFFFFF
+#define HANDOFF_PAGING PAGING_NONE
+#define WARM_BOOT FALSE
+// QEMU debugcon, shared with the benchmark test kernel
+#define BENCH_MARKER_PORT 0xE9
 
-EFI_STATUS KernelLoad(IN EFI_SYSTEM_TABLE * ST, OUT EFI_PHYSICAL_ADDRESS* KernelEntry){
+typedef struct
+{
+    EFI_PHYSICAL_ADDRESS Entry;
+    UINT32 VirtBase;
+    UINT32 PhysBase;
+    UINT32 Size;
+    UINT32 FileIndex;
+    UINT64 FileSize;            // 0 when the file info is unknown
+    EFI_TIME ModificationTime;
+    ResidentHeader* Resident;   // 0 when not kept resident
+} KernelImage;
+
+// Kernel images in fallback order
+static CHAR16* KernelFiles[] = {
+  L"kernel.o",
+  L"kernel.prev.o",
+  L"recovery.o"
+};
+
+#define KERNEL_NFILES (sizeof(KernelFiles) / sizeof(KernelFiles[0]))
+
+static EFI_STATUS KernelFileInfo(IN EFI_FILE_PROTOCOL* File, OUT UINT64* FileSize, OUT EFI_TIME* ModificationTime){
     EFI_STATUS Status;
+    UINT64 InfoBuffer[(SIZE_OF_EFI_FILE_INFO + 256) / sizeof(UINT64)];
+    EFI_FILE_INFO* Info = (EFI_FILE_INFO*)InfoBuffer;
+    UINTN InfoSize = sizeof(InfoBuffer);
 
-    CHAR16* FileName = L"kernel.o";
+    Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
+    if(EFI_ERROR(Status))
+      return Status;
+
+    *FileSize = Info->FileSize;
+    *ModificationTime = Info->ModificationTime;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS KernelLoadFile(IN EFI_SYSTEM_TABLE* ST, IN EFI_FILE_PROTOCOL* Root, IN CHAR16* FileName, IN CHAR8* Buffer, IN UINT32 Paging, OUT KernelImage* Image){
+    EFI_STATUS Status;
 
-    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FileSystem;
-    EFI_FILE_PROTOCOL* Root;
     EFI_FILE_PROTOCOL* File;
-    UINT32 FileSize = FILE_NPAGES * 1024;
-    CHAR8* Buffer;
+    UINTN FileSize = FILE_NPAGES * 1024;
     Elf32_Map map;
     EFI_PHYSICAL_ADDRESS Kernel;
+
+    Status = Root->Open(Root, &File, FileName, EFI_FILE_MODE_READ, 0);
+    if(EFI_ERROR(Status))
+      return Status;
+
+    Status = File->Read(File, &FileSize, Buffer);
+    if(EFI_ERROR(KernelFileInfo(File, &Image->FileSize, &Image->ModificationTime))){
+      Image->FileSize = 0;
+    }
+    File->Close(File);
+    if(EFI_ERROR(Status))
+      return Status;
+
+    // parse only what this read returned, the buffer still holds earlier attempts
+    if(!Elf32GetMap(&map, (CHAR8*)Buffer, (UINT32)FileSize))
+      return EFI_LOAD_ERROR;
+
+    if(!Efl32CheckSupported(map.ehdr) || !Elf32CheckExecutabel(map.ehdr) || !map.nphdr)
+      return EFI_UNSUPPORTED;
+
+    // with paging the image goes to its physical address and is mapped at its virtual one
+    Kernel = Paging == PAGING_NONE? map.phdr[0].p_vaddr : map.phdr[0].p_paddr;
+    Status = ST->BootServices->AllocatePages(AllocateAddress, EfiLoaderCode, FILE_NPAGES, &Kernel);
+    if(EFI_ERROR(Status))
+      return Status;
+
+    Elf32LoadFile(&map, (VOID*)(UINTN)((UINT32)Kernel - map.phdr[0].p_vaddr));
+    Image->Entry = map.ehdr->e_entry;
+    Image->VirtBase = map.phdr[0].p_vaddr;
+    Image->PhysBase = (UINT32)Kernel;
+    Image->Size = FILE_NPAGES * EFI_PAGE_SIZE;
+    Image->Resident = 0;
+
+    return EFI_SUCCESS;
+}
+
+// Reuse the image a previous boot left resident if its file is unchanged
+static EFI_STATUS KernelLoadResident(IN EFI_SYSTEM_TABLE* ST, IN EFI_FILE_PROTOCOL* Root, IN UINT32 Paging, OUT KernelImage* Image){
+    EFI_STATUS Status;
+    ResidentHeader* Header;
+    EFI_FILE_PROTOCOL* File;
+    UINT64 FileSize;
+    EFI_TIME ModificationTime;
+    EFI_PHYSICAL_ADDRESS Kernel;
+
+    Status = ResidentFind(ST, &Header);
+    if(EFI_ERROR(Status))
+      return Status;
+
+    Status = EFI_NOT_FOUND;
+    if(Header->FileIndex < KERNEL_NFILES && Header->Paging == Paging){
+      Status = Root->Open(Root, &File, KernelFiles[Header->FileIndex], EFI_FILE_MODE_READ, 0);
+      if(!EFI_ERROR(Status)){
+        Status = KernelFileInfo(File, &FileSize, &ModificationTime);
+        File->Close(File);
+      }
+      if(!EFI_ERROR(Status) && (FileSize != Header->FileSize ||
+          CompareMem(&ModificationTime, &Header->ModificationTime, sizeof(EFI_TIME)) != 0)){
+        Status = EFI_NOT_FOUND;
+      }
+    }
+
+    if(!EFI_ERROR(Status)){
+      Kernel = Header->PhysBase;
+      Status = ST->BootServices->AllocatePages(AllocateAddress, EfiLoaderCode, EFI_SIZE_TO_PAGES(Header->Size), &Kernel);
+    }
+
+    if(EFI_ERROR(Status)){
+      ResidentDrop(ST, Header);
+      return Status;
+    }
+
+    ResidentRestore(Header);
+    Image->Entry = Header->Entry;
+    Image->VirtBase = Header->VirtBase;
+    Image->PhysBase = Header->PhysBase;
+    Image->Size = Header->Size;
+    Image->FileIndex = Header->FileIndex;
+    Image->FileSize = Header->FileSize;
+    Image->ModificationTime = Header->ModificationTime;
+    Image->Resident = Header;
+
+    return EFI_SUCCESS;
+}
+
+// Keep a copy of the freshly loaded image for the next warm reboot
+static VOID KernelSaveResident(IN EFI_SYSTEM_TABLE* ST, IN UINT32 Paging, IN OUT KernelImage* Image){
+    ResidentHeader Plan;
+
+    if(!Image->FileSize)
+      return;
+
+    Plan.FileIndex = Image->FileIndex;
+    Plan.FileSize = Image->FileSize;
+    Plan.ModificationTime = Image->ModificationTime;
+    Plan.Paging = Paging;
+    Plan.Entry = (UINT32)Image->Entry;
+    Plan.VirtBase = Image->VirtBase;
+    Plan.PhysBase = Image->PhysBase;
+    Plan.Size = Image->Size;
+
+    if(EFI_ERROR(ResidentSave(ST, &Plan, &Image->Resident))){
+      Image->Resident = 0;
+    }
+}
+
+EFI_STATUS KernelLoad(IN EFI_SYSTEM_TABLE * ST, IN UINT32 Paging, IN BOOLEAN WarmBoot, IN OUT VolumeList* Volumes, OUT KernelImage* Image, OUT KernelBootRecord* Record){
+    EFI_STATUS Status;
+
+    EFI_FILE_PROTOCOL* Root;
+    CHAR8* Buffer;
+    KernelBootRecord Last;
+    UINT32 Order[KERNEL_NFILES];
+    UINT32 N = 0;
     BOOLEAN Load_Success = FALSE;
 
+    Record->Index = 0;
+    Record->FailedMask = 0;
+    Record->LastError = 0;
+
+    // try the image that booted last time first
+    if(!EFI_ERROR(BootVarGet(ST, KERNEL_BOOT_VAR, &Last, sizeof(Last))) && Last.Index < KERNEL_NFILES){
+      Order[N++] = Last.Index;
+    }
+    for (UINT32 i = 0; i < KERNEL_NFILES; i++)
+    {
+      if(N == 0 || Order[0] != i){
+        Order[N++] = i;
+      }
+    }
+
     Status = ST->BootServices->AllocatePages(AllocateAnyPages, EfiLoaderCode, FILE_NPAGES,(EFI_PHYSICAL_ADDRESS*) &Buffer);
     if(EFI_ERROR(Status))
       return Status;
 
-    Status = ST->BootServices->LocateProtocol(&gEfiSimpleFileSystemProtocolGuid, NULL, (VOID**)&FileSystem);
+    // best volume first, move on when every image on it fails
+    while (!Load_Success && !EFI_ERROR(VolumeListNext(ST, Volumes, KernelFiles, KERNEL_NFILES, &Root)))
+    {
+      // the record describes the volume that boots, not the ones before it
+      Record->FailedMask = 0;
+      Record->LastError = 0;
 
-    if (!EFI_ERROR(Status)){
-      Status = FileSystem->OpenVolume(FileSystem, &Root);
-      if(!EFI_ERROR(Status)){
-        Status = Root->Open(Root, &File, FileName, EFI_FILE_MODE_READ, 0);
+      // warm reboot, no disk read when the resident image is still current
+      if(WarmBoot && !EFI_ERROR(KernelLoadResident(ST, Root, Paging, Image))){
+        Record->Index = Image->FileIndex;
+        Load_Success = TRUE;
+      }
+
+      for (UINT32 i = 0; i < N && !Load_Success; i++)
+      {
+        Status = KernelLoadFile(ST, Root, KernelFiles[Order[i]], Buffer, Paging, Image);
         if(!EFI_ERROR(Status)){
-          Status = File->Read(File, &FileSize, Buffer);
-          if(!EFI_ERROR(Status)){
-            if(Elf32GetMap(&map, (CHAR8*)Buffer)){
-              if(Efl32CheckSupported(map.ehdr) && Elf32CheckExecutabel(map.ehdr)){
-                if(map.nphdr){
-                  Kernel = map.phdr[0].p_vaddr;
-                  Status = ST->BootServices->AllocatePages(AllocateAddress, EfiLoaderCode, FILE_NPAGES, &Kernel);
-                  if(!EFI_ERROR(Status)){
-                    Elf32LoadFile(&map, 0);
-                    *KernelEntry = map.ehdr->e_entry;
-                    Load_Success = TRUE;
-                  }
-                }
-              }
-            }
-          }
-          File->Close(File);
+          Record->Index = Order[i];
+          Image->FileIndex = Order[i];
+          Load_Success = TRUE;
+        }else{
+          Print(L"Failed To Load %s (%r)\n", KernelFiles[Order[i]], Status);
+          Record->FailedMask |= 1 << Order[i];
+          Record->LastError = (UINT32)Status;
         }
-        Root->Close(Root);
       }
-    }
+      Root->Close(Root);
 
-    if(!Load_Success){
-      ST->BootServices->FreePages((UINT32)Buffer, FILE_NPAGES);
+      // the caller caches the volume once the kernel is sure to start
+      if(!Load_Success){
+        VolumeListReject(ST, Volumes);
+      }
     }
 
+    // the image has been copied out of the read buffer
+    ST->BootServices->FreePages((UINT32)Buffer, FILE_NPAGES);
+
     return Load_Success? EFI_SUCCESS : EFI_UNSUPPORTED;
 }
 
-VOID Handoff(IN EFI_SYSTEM_TABLE* ST, IN EFI_PHYSICAL_ADDRESS KernelEntry){
-      EFI_STATUS Status;
-      GraphicsInfo* GI;
-      MemoryInfo* MI;
+// Give back what KernelLoad reserved for a kernel that will not start
+static VOID KernelUnload(IN EFI_SYSTEM_TABLE* ST, IN KernelImage* Image){
+    ST->BootServices->FreePages(Image->PhysBase, EFI_SIZE_TO_PAGES(Image->Size));
+    if(Image->Resident){
+      ResidentFree(ST, Image->Resident);
+      Image->Resident = 0;
+    }
+}
 
-      Status = GetGraphicsInfo(ST, &GI);
-      if(EFI_ERROR(Status)){
-        GI = 0;
+// Record the booted image, skipping the NV write when nothing changed
+static VOID KernelRecordBoot(IN EFI_SYSTEM_TABLE* ST, IN KernelBootRecord* Record){
+    KernelBootRecord Last;
+
+    if(!EFI_ERROR(BootVarGet(ST, KERNEL_BOOT_VAR, &Last, sizeof(Last))) &&
+        Last.Index == Record->Index && Last.FailedMask == Record->FailedMask && Last.LastError == Record->LastError){
+      return;
+    }
+
+    BootVarSet(ST, KERNEL_BOOT_VAR, Record, sizeof(*Record));
+}
+
+// Wait for a key or until Seconds elapse, KEY_TIMEOUT_INFINITE waits forever
+static EFI_STATUS WaitForKeyTimeout(IN EFI_SYSTEM_TABLE* ST, IN UINT32 Seconds){
+    EFI_STATUS Status;
+    EFI_EVENT Events[2];
+    UINTN NEvents = 1;
+    UINTN Index;
+    EFI_INPUT_KEY Key;
+
+    if(Seconds == 0)
+      return EFI_TIMEOUT;
+
+    Status = ST->ConIn->Reset(ST->ConIn, FALSE);
+    if (EFI_ERROR(Status))
+      return Status;
+
+    Events[0] = ST->ConIn->WaitForKey;
+    if(Seconds != KEY_TIMEOUT_INFINITE){
+      Status = ST->BootServices->CreateEvent(EVT_TIMER, 0, NULL, NULL, &Events[1]);
+      if (EFI_ERROR(Status))
+        return Status;
+      // timer period is in 100ns units
+      Status = ST->BootServices->SetTimer(Events[1], TimerRelative, MultU64x32(Seconds, 10000000));
+      if (EFI_ERROR(Status)){
+        ST->BootServices->CloseEvent(Events[1]);
+        return Status;
       }
+      NEvents = 2;
+    }
+
+    Status = ST->BootServices->WaitForEvent(NEvents, Events, &Index);
+    if(NEvents == 2){
+      ST->BootServices->CloseEvent(Events[1]);
+    }
+    if (EFI_ERROR(Status))
+      return Status;
+
+    if(Index == 1)
+      return EFI_TIMEOUT;
+
+    return ST->ConIn->ReadKeyStroke(ST->ConIn, &Key);
+}
+
+VOID Handoff(IN EFI_SYSTEM_TABLE* ST, IN GraphicsInfo* GI, IN PagingInfo* PI, IN KernelImage* Image){
+      EFI_STATUS Status;
+      MemoryInfo* MI;
+      EFI_PHYSICAL_ADDRESS KernelEntry = Image->Entry;
+      UINT32 Cr0 = CR0_PE;
+      UINT32 Cr3 = 0;
+      UINT32 Cr4 = 0;
 
       Status = GetMemoryInfo(ST, &MI);
       if(EFI_ERROR(Status)){
         MI = 0;
       }
 
+      if(PI){
+        Cr0 |= CR0_PG;
+        Cr3 = PI->PageDirectory;
+        Cr4 = PI->Mode == PAGING_PAE? CR4_PAE : CR4_PSE;
+      }
+
       asm("cli\n\t"
           "mov $0x1, %%ebx\n\t"
           "mov %%ebx, %%cr0\n\t"
-          "xor %%ebx, %%ebx\n\t"
+          "mov %1, %%ebx\n\t"
           "mov %%ebx, %%cr4\n\t"
+          "mov %2, %%ebx\n\t"
           "mov %%ebx, %%cr3\n\t"
+          "mov %3, %%ebx\n\t"
+          "mov %%ebx, %%cr0\n\t"
           "call %0"
-          ::   "m"(KernelEntry), "a"(LOADER_GUID), "c"(MI), "d"(GI)
+          ::   "m"(KernelEntry), "m"(Cr4), "m"(Cr3), "m"(Cr0), "a"(LOADER_GUID), "c"(MI), "d"(GI), "S"(PI), "D"(Image->Resident)
+          :    "ebx"
       );
 }
 
+#ifdef BENCH_MARKER
+// Start marker for MyAppPkg/Bench, built with -D BENCH_MARKER
+static VOID BenchMarker(IN CHAR8* Marker){
+    while (*Marker)
+    {
+      IoWrite8(BENCH_MARKER_PORT, *Marker++);
+    }
+}
+#endif
+
 EFI_STATUS
 EFIAPI
 UefiMain (
@@ -99,7 +359,13 @@ UefiMain (
   )
 {
     EFI_STATUS Status;
-    EFI_INPUT_KEY Key;
+    UINT32 Timeout;
+    UINT32 Paging;
+    UINT32 WarmBoot;
+
+#ifdef BENCH_MARKER
+    BenchMarker("LSTART\n");
+#endif
 
     EFI_SYSTEM_TABLE* ST = SystemTable;
 
@@ -109,21 +375,61 @@ UefiMain (
 
     ST->ConOut->EnableCursor(ST->ConOut, TRUE);
 
-    EFI_PHYSICAL_ADDRESS KernelEntry;
-    Status = KernelLoad(ST, &KernelEntry);
+    if(EFI_ERROR(BootVarGet(ST, HANDOFF_PAGING_VAR, &Paging, sizeof(Paging))) ||
+        (Paging != PAGING_NONE && Paging != PAGING_PSE && Paging != PAGING_PAE)){
+      Paging = HANDOFF_PAGING;
+    }
+
+    if(EFI_ERROR(BootVarGet(ST, WARM_BOOT_VAR, &WarmBoot, sizeof(WarmBoot)))){
+      WarmBoot = WARM_BOOT;
+    }
+
+    KernelImage Image;
+    KernelBootRecord Record;
+    VolumeList Volumes;
+    VolumeListInit(&Volumes);
+    Status = KernelLoad(ST, Paging, WarmBoot != 0, &Volumes, &Image, &Record);
 
     if(EFI_ERROR(Status)){
-      Print(L"Failed To Load Kernel");
+      Print(L"Failed To Load Kernel\n");
     }else{
       Print(L"Kerenel Loaded Successfully\n");
-      Handoff(ST, KernelEntry);      
-    }
 
-    Status = ST->ConIn->Reset(ST->ConIn, FALSE);
-    if (EFI_ERROR(Status))
-        return Status;
+      GraphicsInfo* GI;
+      Status = GetGraphicsInfo(ST, &GI);
+      if(EFI_ERROR(Status)){
+        GI = 0;
+      }
 
-    while ((Status = ST->ConIn->ReadKeyStroke(ST->ConIn, &Key)) == EFI_NOT_READY) ;
+      // page tables first, nothing is committed for a kernel that cannot start
+      PagingInfo* PI = 0;
+      if(Paging != PAGING_NONE){
+        Status = PagingBuild(ST, Paging, Image.VirtBase, Image.PhysBase, Image.Size,
+          GI? GI->FameBufferBase : 0, GI? GI->FrameBufferSize : 0, &PI);
+      }
+
+      if(Paging != PAGING_NONE && EFI_ERROR(Status)){
+        Print(L"Failed To Set Up Paging (%r)\n", Status);
+        // control goes back to firmware, leave nothing behind for the next boot option
+        KernelUnload(ST, &Image);
+        if(GI){
+          ST->BootServices->FreePool(GI);
+        }
+      }else{
+        VolumeListCommit(ST, &Volumes);
+        KernelRecordBoot(ST, &Record);
+        if(WarmBoot && !Image.Resident){
+          KernelSaveResident(ST, Paging, &Image);
+        }
+        Handoff(ST, GI, PI, &Image);
+      }
+    }
+    VolumeListFree(ST, &Volumes);
+
+    if(EFI_ERROR(BootVarGet(ST, KEY_TIMEOUT_VAR, &Timeout, sizeof(Timeout)))){
+      Timeout = KEY_TIMEOUT_SECONDS;
+    }
 
-    return Status;
+    // returning hands control back to the boot manager
+    return WaitForKeyTimeout(ST, Timeout);
 }
@@ -0,0 +1,105 @@
+#include "Paging.h"
+
+#include "LibC.h"
+
+#define PDE_PRESENT 0x001
+#define PDE_WRITE   0x002
+#define PDE_LARGE   0x080
+
+static inline UINT64 PagingPageSize(IN UINT32 Mode){
+    return Mode == PAGING_PAE? SIZE_2MB : SIZE_4MB;
+}
+
+// PAE page directories are contiguous, so both modes index one flat table
+static inline VOID PagingMap(IN VOID* Directory, IN UINT32 Mode, IN UINT64 Virt, IN UINT64 Phys){
+    if(Mode == PAGING_PAE){
+        ((UINT64*)Directory)[Virt >> 21] = Phys | PDE_LARGE | PDE_WRITE | PDE_PRESENT;
+    }else{
+        ((UINT32*)Directory)[Virt >> 22] = (UINT32)Phys | PDE_LARGE | PDE_WRITE | PDE_PRESENT;
+    }
+}
+
+// Virt and Phys must be congruent modulo the page size
+static VOID PagingMapRange(IN VOID* Directory, IN UINT32 Mode, IN UINT64 Virt, IN UINT64 Phys, IN UINT64 Size){
+    UINT64 PageSize = PagingPageSize(Mode);
+    UINT64 End = Virt + Size;
+
+    Phys -= Virt & (PageSize - 1);
+    Virt -= Virt & (PageSize - 1);
+    for (; Virt < End && Virt < SIZE_4GB; Virt += PageSize, Phys += PageSize)
+    {
+        PagingMap(Directory, Mode, Virt, Phys);
+    }
+}
+
+EFI_STATUS PagingBuild(IN EFI_SYSTEM_TABLE* ST, IN UINT32 Mode, IN UINT32 KernelVirt, IN UINT32 KernelPhys, IN UINT32 KernelSize,
+    IN UINT32 FrameBufferBase, IN UINT32 FrameBufferSize, OUT PagingInfo** PI){
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Table = SIZE_4GB - 1;
+    UINTN NPages = Mode == PAGING_PAE? 5 : 1;
+    UINT64 PageSize = PagingPageSize(Mode);
+    // whole large pages of the kernel window, as PagingMapRange maps them
+    UINT64 WindowStart = KernelVirt & ~(PageSize - 1);
+    UINT64 WindowEnd = ALIGN_VALUE((UINT64)KernelVirt + KernelSize, PageSize);
+    UINT64 FrameBufferVirt = FrameBufferBase;
+    VOID* Directory;
+
+    if(Mode != PAGING_PSE && Mode != PAGING_PAE){
+        return EFI_UNSUPPORTED;
+    }
+
+    // the kernel window is mapped with large pages only
+    if(((KernelVirt ^ KernelPhys) & (PageSize - 1)) != 0){
+        return EFI_UNSUPPORTED;
+    }
+
+    // CR3 holds a 32 bit address
+    Status = ST->BootServices->AllocatePages(AllocateMaxAddress, EfiLoaderData, NPages, &Table);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    PagingInfo* PInfo;
+    Status = ST->BootServices->AllocatePool(EfiBootServicesData, sizeof(PagingInfo), (VOID**)&PInfo);
+    if(EFI_ERROR(Status)){
+        ST->BootServices->FreePages(Table, NPages);
+        return Status;
+    }
+
+    MemSet((CHAR8*)(UINTN)Table, 0, NPages * EFI_PAGE_SIZE);
+    Directory = (VOID*)(UINTN)Table;
+    if(Mode == PAGING_PAE){
+        UINT64* Pdpt = (UINT64*)(UINTN)Table;
+        for (UINT32 i = 0; i < 4; i++)
+        {
+            Pdpt[i] = (Table + (i + 1) * EFI_PAGE_SIZE) | PDE_PRESENT;
+        }
+        Directory = (VOID*)(UINTN)(Table + EFI_PAGE_SIZE);
+    }
+
+    // identity map all of 4 GiB, then overlay the kernel window
+    PagingMapRange(Directory, Mode, 0, 0, SIZE_4GB);
+    PagingMapRange(Directory, Mode, KernelVirt, KernelPhys, KernelSize);
+
+    // move the frame buffer past the kernel if the kernel window hides it
+    if(FrameBufferSize && FrameBufferVirt < WindowEnd && FrameBufferVirt + FrameBufferSize > WindowStart){
+        FrameBufferVirt = WindowEnd + (FrameBufferBase & (PageSize - 1));
+        if(FrameBufferVirt + FrameBufferSize <= SIZE_4GB){
+            PagingMapRange(Directory, Mode, FrameBufferVirt, FrameBufferBase, FrameBufferSize);
+        }else{
+            FrameBufferVirt = 0;
+        }
+    }
+
+    PInfo->Mode = Mode;
+    PInfo->PageDirectory = (UINT32)Table;
+    PInfo->KernelVirtBase = KernelVirt;
+    PInfo->KernelPhysBase = KernelPhys;
+    PInfo->KernelSize = KernelSize;
+    PInfo->IdentitySizeMB = 4096;
+    PInfo->FrameBufferVirtBase = FrameBufferSize? (UINT32)FrameBufferVirt : 0;
+
+    *PI = PInfo;
+
+    return EFI_SUCCESS;
+}
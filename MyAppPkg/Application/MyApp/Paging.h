@@ -0,0 +1,25 @@
+#include <Uefi.h>
+
+// Handoff paging modes
+#define PAGING_NONE 0
+#define PAGING_PSE  1   // 4 MiB pages
+#define PAGING_PAE  2   // 2 MiB pages
+
+#define CR0_PE  0x00000001
+#define CR0_PG  0x80000000
+#define CR4_PSE 0x00000010
+#define CR4_PAE 0x00000020
+
+typedef struct
+{
+    UINT32 Mode;
+    UINT32 PageDirectory;       // Value loaded into CR3
+    UINT32 KernelVirtBase;
+    UINT32 KernelPhysBase;
+    UINT32 KernelSize;
+    UINT32 IdentitySizeMB;      // Identity mapped from 0, outside the kernel and frame buffer windows
+    UINT32 FrameBufferVirtBase; // 0 when not mapped
+} PagingInfo;
+
+EFI_STATUS PagingBuild(IN EFI_SYSTEM_TABLE* ST, IN UINT32 Mode, IN UINT32 KernelVirt, IN UINT32 KernelPhys, IN UINT32 KernelSize,
+    IN UINT32 FrameBufferBase, IN UINT32 FrameBufferSize, OUT PagingInfo** PI);
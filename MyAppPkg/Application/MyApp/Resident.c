@@ -0,0 +1,102 @@
+#include "Resident.h"
+
+#include "LibC.h"
+
+#define RESIDENT_IMAGE(Header) ((CHAR8*)(Header) + EFI_PAGE_SIZE)
+
+static UINT32 ResidentHeaderCrc(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Header){
+    UINT32 Saved = Header->HeaderCrc;
+    UINT32 Crc = 0;
+
+    Header->HeaderCrc = 0;
+    ST->BootServices->CalculateCrc32(Header, sizeof(ResidentHeader), &Crc);
+    Header->HeaderCrc = Saved;
+
+    return Crc;
+}
+
+// Snapshot Plan->Size bytes at Plan->PhysBase into the resident range
+EFI_STATUS ResidentSave(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Plan, OUT ResidentHeader** Header){
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Base = RESIDENT_BASE;
+    ResidentHeader* H;
+
+    // reserved, so the kernel keeps its hands off the range
+    Status = ST->BootServices->AllocatePages(AllocateAddress, EfiReservedMemoryType, 1 + EFI_SIZE_TO_PAGES(Plan->Size), &Base);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    H = (ResidentHeader*)(UINTN)Base;
+    MemCopy((CHAR8*)Plan, (CHAR8*)H, sizeof(ResidentHeader));
+    MemCopy((CHAR8*)(UINTN)Plan->PhysBase, RESIDENT_IMAGE(H), Plan->Size);
+    H->Magic = RESIDENT_MAGIC;
+    H->Version = RESIDENT_VERSION;
+
+    Status = ST->BootServices->CalculateCrc32(RESIDENT_IMAGE(H), H->Size, &H->ImageCrc);
+    if(EFI_ERROR(Status)){
+        ResidentDrop(ST, H);
+        return Status;
+    }
+    H->HeaderCrc = ResidentHeaderCrc(ST, H);
+
+    *Header = H;
+
+    return EFI_SUCCESS;
+}
+
+// Reserve and validate the resident range left by a previous boot
+EFI_STATUS ResidentFind(IN EFI_SYSTEM_TABLE* ST, OUT ResidentHeader** Header){
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Base = RESIDENT_BASE;
+    EFI_PHYSICAL_ADDRESS Image = RESIDENT_BASE + EFI_PAGE_SIZE;
+    ResidentHeader* H;
+    UINT32 Crc;
+
+    Status = ST->BootServices->AllocatePages(AllocateAddress, EfiReservedMemoryType, 1, &Base);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    H = (ResidentHeader*)(UINTN)Base;
+    if(H->Magic != RESIDENT_MAGIC || H->Version != RESIDENT_VERSION || H->HeaderCrc != ResidentHeaderCrc(ST, H) || !H->Size){
+        ST->BootServices->FreePages(Base, 1);
+        return EFI_NOT_FOUND;
+    }
+
+    Status = ST->BootServices->AllocatePages(AllocateAddress, EfiReservedMemoryType, EFI_SIZE_TO_PAGES(H->Size), &Image);
+    if(EFI_ERROR(Status)){
+        ST->BootServices->FreePages(Base, 1);
+        return Status;
+    }
+
+    Status = ST->BootServices->CalculateCrc32(RESIDENT_IMAGE(H), H->Size, &Crc);
+    if(EFI_ERROR(Status) || Crc != H->ImageCrc){
+        ResidentDrop(ST, H);
+        return EFI_CRC_ERROR;
+    }
+
+    *Header = H;
+
+    return EFI_SUCCESS;
+}
+
+VOID ResidentRestore(IN ResidentHeader* Header){
+    MemCopy(RESIDENT_IMAGE(Header), (CHAR8*)(UINTN)Header->PhysBase, Header->Size);
+}
+
+// Release the range, the snapshot stays valid for a later boot
+VOID ResidentFree(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Header){
+    EFI_PHYSICAL_ADDRESS Base = (UINTN)Header;
+    UINTN NPages = EFI_SIZE_TO_PAGES(Header->Size);
+
+    ST->BootServices->FreePages(Base + EFI_PAGE_SIZE, NPages);
+    ST->BootServices->FreePages(Base, 1);
+}
+
+VOID ResidentDrop(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Header){
+    // never pick up a stale snapshot again
+    Header->Magic = 0;
+
+    ResidentFree(ST, Header);
+}
@@ -0,0 +1,32 @@
+#include <Uefi.h>
+
+// Resident range: header page followed by the image snapshot
+#define RESIDENT_BASE    0x03000000
+#define RESIDENT_MAGIC   SIGNATURE_64('K', 'R', 'E', 'S', 'I', 'D', 'N', 'T')
+#define RESIDENT_VERSION 1
+
+typedef struct
+{
+    UINT64 Magic;
+    UINT32 Version;
+    UINT32 HeaderCrc;           // Crc of this header with HeaderCrc zero
+    UINT32 ImageCrc;            // Crc of the image snapshot
+    UINT32 FileIndex;
+    UINT64 FileSize;
+    EFI_TIME ModificationTime;
+    UINT32 Paging;
+    UINT32 Entry;
+    UINT32 VirtBase;
+    UINT32 PhysBase;
+    UINT32 Size;
+} ResidentHeader;
+
+EFI_STATUS ResidentSave(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Plan, OUT ResidentHeader** Header);
+
+EFI_STATUS ResidentFind(IN EFI_SYSTEM_TABLE* ST, OUT ResidentHeader** Header);
+
+VOID ResidentRestore(IN ResidentHeader* Header);
+
+VOID ResidentFree(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Header);
+
+VOID ResidentDrop(IN EFI_SYSTEM_TABLE* ST, IN ResidentHeader* Header);
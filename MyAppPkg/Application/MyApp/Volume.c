@@ -0,0 +1,207 @@
+#include "Volume.h"
+#include "BootVar.h"
+#include <Library/DevicePathLib.h>
+#include <Protocol/DevicePath.h>
+
+typedef struct
+{
+    EFI_HANDLE Handle;
+    UINT32 Rank;
+} VolumeCandidate;
+
+static UINT32 VolumeRank(IN EFI_DEVICE_PATH_PROTOCOL* DevicePath){
+    EFI_DEVICE_PATH_PROTOCOL* Node;
+
+    // the first storage node from the root decides, so USB attached SCSI stays USB
+    for (Node = DevicePath; !IsDevicePathEnd(Node); Node = NextDevicePathNode(Node))
+    {
+        if(DevicePathType(Node) == MESSAGING_DEVICE_PATH){
+            switch (DevicePathSubType(Node))
+            {
+            case MSG_NVME_NAMESPACE_DP:
+                return VOLUME_RANK_NVME;
+            case MSG_SATA_DP:
+            case MSG_ATAPI_DP:
+            case MSG_SCSI_DP:
+                return VOLUME_RANK_SATA;
+            case MSG_USB_DP:
+            case MSG_USB_CLASS_DP:
+            case MSG_USB_WWID_DP:
+                return VOLUME_RANK_USB;
+            }
+        }else if(DevicePathType(Node) == MEDIA_DEVICE_PATH && DevicePathSubType(Node) == MEDIA_RAM_DISK_DP){
+            return VOLUME_RANK_VIRTUAL;
+        }
+    }
+    return VOLUME_RANK_OTHER;
+}
+
+// Open the volume on Handle if it holds any of Files
+static EFI_STATUS VolumeOpen(IN EFI_SYSTEM_TABLE* ST, IN EFI_HANDLE Handle, IN CHAR16** Files, IN UINT32 NFiles, OUT EFI_FILE_PROTOCOL** Root){
+    EFI_STATUS Status;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FileSystem;
+    EFI_FILE_PROTOCOL* File;
+
+    Status = ST->BootServices->HandleProtocol(Handle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&FileSystem);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    Status = FileSystem->OpenVolume(FileSystem, Root);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    for (UINT32 i = 0; i < NFiles; i++)
+    {
+        if(!EFI_ERROR((*Root)->Open(*Root, &File, Files[i], EFI_FILE_MODE_READ, 0))){
+            File->Close(File);
+            return EFI_SUCCESS;
+        }
+    }
+
+    (*Root)->Close(*Root);
+    return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS VolumeFindCached(IN EFI_SYSTEM_TABLE* ST, OUT EFI_HANDLE* Handle){
+    EFI_STATUS Status;
+    EFI_DEVICE_PATH_PROTOCOL* Cached;
+    EFI_DEVICE_PATH_PROTOCOL* Remaining;
+    UINTN CachedSize;
+
+    Status = BootVarGetPool(ST, KERNEL_DEVICE_VAR, (VOID**)&Cached, &CachedSize);
+    if(EFI_ERROR(Status)){
+        return Status;
+    }
+
+    Status = EFI_NOT_FOUND;
+    if(IsDevicePathValid(Cached, CachedSize)){
+        Remaining = Cached;
+        Status = ST->BootServices->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &Remaining, Handle);
+        if(!EFI_ERROR(Status) && !IsDevicePathEnd(Remaining)){
+            // only an exact match is the cached volume
+            Status = EFI_NOT_FOUND;
+        }
+    }
+
+    ST->BootServices->FreePool(Cached);
+    return Status;
+}
+
+// Rank every SimpleFileSystem handle, best first
+static VOID VolumeScan(IN EFI_SYSTEM_TABLE* ST, IN OUT VolumeList* List){
+    EFI_STATUS Status;
+    VolumeCandidate* Candidates;
+    VolumeCandidate Candidate;
+    EFI_DEVICE_PATH_PROTOCOL* DevicePath;
+
+    List->Scanned = TRUE;
+
+    Status = ST->BootServices->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &List->NHandles, &List->Handles);
+    if(EFI_ERROR(Status)){
+        List->Handles = NULL;
+        List->NHandles = 0;
+        return;
+    }
+
+    // unranked order if there is no memory to sort in
+    Status = ST->BootServices->AllocatePool(EfiBootServicesData, List->NHandles * sizeof(VolumeCandidate), (VOID**)&Candidates);
+    if(EFI_ERROR(Status)){
+        return;
+    }
+
+    // rank and insertion sort
+    for (UINTN i = 0; i < List->NHandles; i++)
+    {
+        Candidate.Handle = List->Handles[i];
+        Candidate.Rank = VOLUME_RANK_VIRTUAL;
+        if(!EFI_ERROR(ST->BootServices->HandleProtocol(List->Handles[i], &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath))){
+            Candidate.Rank = VolumeRank(DevicePath);
+        }
+
+        UINTN j = i;
+        while (j > 0 && Candidates[j - 1].Rank < Candidate.Rank)
+        {
+            Candidates[j] = Candidates[j - 1];
+            j--;
+        }
+        Candidates[j] = Candidate;
+    }
+
+    for (UINTN i = 0; i < List->NHandles; i++)
+    {
+        List->Handles[i] = Candidates[i].Handle;
+    }
+    ST->BootServices->FreePool(Candidates);
+}
+
+VOID VolumeListInit(OUT VolumeList* List){
+    List->Handles = NULL;
+    List->NHandles = 0;
+    List->Next = 0;
+    List->Scanned = FALSE;
+    List->CacheTried = FALSE;
+    List->Cached = NULL;
+    List->Current = NULL;
+}
+
+// Open the next volume holding any of Files, the cached device first
+EFI_STATUS VolumeListNext(IN EFI_SYSTEM_TABLE* ST, IN OUT VolumeList* List, IN CHAR16** Files, IN UINT32 NFiles, OUT EFI_FILE_PROTOCOL** Root){
+    EFI_HANDLE Handle;
+
+    if(!List->CacheTried){
+        List->CacheTried = TRUE;
+        if(!EFI_ERROR(VolumeFindCached(ST, &Handle))){
+            List->Cached = Handle;
+            if(!EFI_ERROR(VolumeOpen(ST, Handle, Files, NFiles, Root))){
+                List->Current = Handle;
+                return EFI_SUCCESS;
+            }
+        }
+    }
+
+    if(!List->Scanned){
+        VolumeScan(ST, List);
+    }
+
+    while (List->Next < List->NHandles)
+    {
+        Handle = List->Handles[List->Next++];
+        if(Handle != List->Cached && !EFI_ERROR(VolumeOpen(ST, Handle, Files, NFiles, Root))){
+            List->Current = Handle;
+            return EFI_SUCCESS;
+        }
+    }
+
+    List->Current = NULL;
+    return EFI_NOT_FOUND;
+}
+
+// A kernel loaded from the current volume, cache it for later boots
+VOID VolumeListCommit(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List){
+    EFI_DEVICE_PATH_PROTOCOL* DevicePath;
+
+    if(List->Current == List->Cached){
+        return;
+    }
+
+    if(!EFI_ERROR(ST->BootServices->HandleProtocol(List->Current, &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath))){
+        BootVarSet(ST, KERNEL_DEVICE_VAR, DevicePath, GetDevicePathSize(DevicePath));
+    }
+}
+
+// Every image on the current volume failed, forget it if it was cached.
+// Cached keeps the handle so the scan does not retry the volume.
+VOID VolumeListReject(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List){
+    if(List->Current == List->Cached){
+        BootVarDelete(ST, KERNEL_DEVICE_VAR);
+    }
+}
+
+VOID VolumeListFree(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List){
+    if(List->Handles){
+        ST->BootServices->FreePool(List->Handles);
+        List->Handles = NULL;
+    }
+}
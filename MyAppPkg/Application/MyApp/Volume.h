@@ -0,0 +1,31 @@
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+// Device ranks, higher is preferred
+#define VOLUME_RANK_VIRTUAL 0
+#define VOLUME_RANK_USB     1
+#define VOLUME_RANK_OTHER   2
+#define VOLUME_RANK_SATA    3
+#define VOLUME_RANK_NVME    4
+
+// Volumes in load order, the cached one first
+typedef struct
+{
+    EFI_HANDLE* Handles;    // Ranked, best first
+    UINTN NHandles;
+    UINTN Next;
+    BOOLEAN Scanned;
+    BOOLEAN CacheTried;
+    EFI_HANDLE Cached;
+    EFI_HANDLE Current;
+} VolumeList;
+
+VOID VolumeListInit(OUT VolumeList* List);
+
+EFI_STATUS VolumeListNext(IN EFI_SYSTEM_TABLE* ST, IN OUT VolumeList* List, IN CHAR16** Files, IN UINT32 NFiles, OUT EFI_FILE_PROTOCOL** Root);
+
+VOID VolumeListCommit(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List);
+
+VOID VolumeListReject(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List);
+
+VOID VolumeListFree(IN EFI_SYSTEM_TABLE* ST, IN VolumeList* List);
@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+"""Boot-latency benchmark for the MyApp loader.
+
+Builds one FAT ESP image per synthetic kernel variant and boots each under
+QEMU/OVMF. The loader, built with -D BENCH_MARKER, writes LOADER_MARKER to
+the debugcon port on entry and the test kernel writes KERNEL_MARKER; the
+host time between the two is the time to entry. Results are written as JSON.
+"""
+
+import argparse
+import json
+import os
+import select
+import shutil
+import struct
+import subprocess
+import sys
+import time
+
+# Limits mirrored from MyApp.c: the file buffer is FILE_NPAGES * 1024 bytes
+# and FILE_NPAGES pages are reserved at the first segment address.
+FILE_NPAGES = 64
+MAX_FILE_SIZE = FILE_NPAGES * 1024
+MAX_IMAGE_SIZE = FILE_NPAGES * 4096
+
+DEBUGCON_PORT = 0xE9
+EXIT_PORT = 0xF4
+LOADER_MARKER = b"LSTART\n"
+KERNEL_MARKER = b"KENTRY\n"
+
+ELF_HEADER_SIZE = 52
+PHDR_SIZE = 32
+SHDR_SIZE = 40
+
+PT_LOAD = 1
+PF_X, PF_W, PF_R = 1, 2, 4
+SHT_PROGBITS, SHT_STRTAB, SHT_NOBITS = 1, 3, 8
+SHF_WRITE, SHF_ALLOC, SHF_EXECINSTR = 1, 2, 4
+
+
+def entry_code(base):
+    """Writes KERNEL_MARKER to the debugcon port, then exits QEMU via isa-debug-exit."""
+    code = bytes([
+        0xFC,                               # cld
+        0xBE, 0, 0, 0, 0,                   # mov esi, msg
+        0x66, 0xBA, DEBUGCON_PORT, 0x00,    # mov dx, DEBUGCON_PORT
+        0xAC,                               # lodsb
+        0x84, 0xC0,                         # test al, al
+        0x74, 0x03,                         # jz exit
+        0xEE,                               # out dx, al
+        0xEB, 0xF8,                         # jmp lodsb
+        0xB0, 0x00,                         # exit: mov al, 0
+        0xE6, EXIT_PORT,                    # out EXIT_PORT, al
+        0xFA,                               # cli
+        0xF4,                               # hlt
+        0xEB, 0xFD,                         # jmp hlt
+    ])
+    msg = base + len(code)
+    code = code[:2] + struct.pack("<I", msg) + code[6:]
+    return code + KERNEL_MARKER + b"\0"
+
+
+def align(value, alignment):
+    return (value + alignment - 1) & ~(alignment - 1)
+
+
+def make_kernel(base, text_size, nsegs, bss_size):
+    """Returns an ELF32 executable of about text_size bytes split over nsegs
+    PT_LOAD segments, with bss_size bytes of .bss after the last one."""
+    shstrtab = b"\0.text\0.bss\0.shstrtab\0"
+    nshdr = 4 if bss_size else 3
+
+    first = align(ELF_HEADER_SIZE + nsegs * PHDR_SIZE, 16)
+    # segment 0 sits at base, which must be page aligned for AllocateAddress
+    code = entry_code(base)
+    seg_size = max(align(text_size // nsegs, 16), align(len(code), 16))
+
+    segments = []
+    offset = first
+    for i in range(nsegs):
+        data = bytearray(seg_size)
+        if i == 0:
+            data[:len(code)] = code
+        else:
+            data[:] = bytes((offset + j) & 0xFF for j in range(seg_size))
+        segments.append((offset, bytes(data)))
+        offset += seg_size
+
+    strtab_off = offset
+    shoff = align(strtab_off + len(shstrtab), 4)
+    image_size = offset - first + bss_size
+
+    ehdr = b"\x7fELF" + bytes([1, 1, 1, 0]) + bytes(8)
+    ehdr += struct.pack("<HHIIIIIHHHHHH",
+                        2, 3, 1,                     # ET_EXEC, EM_386, EV_CURRENT
+                        base,                        # e_entry
+                        ELF_HEADER_SIZE, shoff, 0,
+                        ELF_HEADER_SIZE, PHDR_SIZE, nsegs,
+                        SHDR_SIZE, nshdr, nshdr - 1)
+
+    phdrs = b""
+    for i, (off, data) in enumerate(segments):
+        memsz = len(data) + (bss_size if i == nsegs - 1 else 0)
+        flags = PF_R | PF_X if i == 0 else PF_R | PF_W
+        phdrs += struct.pack("<IIIIIIII", PT_LOAD, off, base + off - first, base + off - first,
+                             len(data), memsz, flags, 16)
+
+    shdrs = bytes(SHDR_SIZE)
+    shdrs += struct.pack("<IIIIIIIIII", 1, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                         base, first, offset - first, 0, 0, 16, 0)
+    if bss_size:
+        shdrs += struct.pack("<IIIIIIIIII", 7, SHT_NOBITS, SHF_ALLOC | SHF_WRITE,
+                             base + offset - first, offset, bss_size, 0, 0, 16, 0)
+    shdrs += struct.pack("<IIIIIIIIII", 12, SHT_STRTAB, 0,
+                         0, strtab_off, len(shstrtab), 0, 0, 1, 0)
+
+    image = bytearray(ehdr + phdrs)
+    image += bytes(first - len(image))
+    for _, data in segments:
+        image += data
+    image += shstrtab
+    image += bytes(shoff - len(image))
+    image += shdrs
+    return bytes(image), image_size
+
+
+def make_esp(path, app, kernel):
+    if os.path.exists(path):
+        os.remove(path)
+    with open(path, "wb") as f:
+        f.truncate(64 * 1024 * 1024)
+    subprocess.run(["mformat", "-i", path, "-F", "::"], check=True)
+    subprocess.run(["mmd", "-i", path, "::/EFI", "::/EFI/BOOT"], check=True)
+    subprocess.run(["mcopy", "-i", path, app, "::/EFI/BOOT/BOOTIA32.EFI"], check=True)
+    subprocess.run(["mcopy", "-i", path, kernel, "::/kernel.o"], check=True)
+
+
+def boot_once(args, esp, vars_file):
+    """Returns (loader entry to kernel entry, QEMU launch to kernel entry) in
+    seconds, or None if either marker is missing."""
+    cmd = [
+        args.qemu, "-machine", "q35", "-m", "256M",
+        "-display", "none", "-serial", "none", "-monitor", "none",
+        "-drive", "if=pflash,format=raw,readonly=on,file=%s" % args.ovmf_code,
+        "-drive", "if=pflash,format=raw,file=%s" % vars_file,
+        "-drive", "format=raw,file=%s,snapshot=on" % esp,
+        "-chardev", "stdio,id=dbg",
+        "-device", "isa-debugcon,iobase=%#x,chardev=dbg" % DEBUGCON_PORT,
+        "-device", "isa-debug-exit,iobase=%#x,iosize=1" % EXIT_PORT,
+    ] + args.qemu_arg
+
+    start = time.monotonic()
+    proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL)
+    fd = proc.stdout.fileno()
+    seen = b""
+    loader = None
+    result = None
+    try:
+        while True:
+            remaining = args.timeout - (time.monotonic() - start)
+            if remaining <= 0 or not select.select([fd], [], [], remaining)[0]:
+                break
+            chunk = os.read(fd, 4096)
+            now = time.monotonic()
+            if not chunk:
+                break
+            seen += chunk
+            if loader is None and LOADER_MARKER in seen:
+                loader = now
+                seen = seen[seen.index(LOADER_MARKER) + len(LOADER_MARKER):]
+            if loader is not None and KERNEL_MARKER in seen:
+                result = (now - loader, now - start)
+                break
+    finally:
+        if proc.poll() is None:
+            proc.kill()
+        proc.wait()
+    return result
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return None
+    k = (len(sorted_values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(sorted_values) - 1)
+    return sorted_values[lo] + (sorted_values[hi] - sorted_values[lo]) * (k - lo)
+
+
+def summarize(samples):
+    values = sorted(s * 1000.0 for s in samples)
+    result = {"count": len(values)}
+    if values:
+        result.update({
+            "min_ms": values[0],
+            "max_ms": values[-1],
+            "mean_ms": sum(values) / len(values),
+            "p50_ms": percentile(values, 50),
+            "p90_ms": percentile(values, 90),
+            "p99_ms": percentile(values, 99),
+        })
+    return result
+
+
+def int_list(text):
+    return [int(v, 0) for v in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--app", required=True, help="built MyApp.efi")
+    parser.add_argument("--out-dir", required=True)
+    parser.add_argument("--qemu", default="qemu-system-i386")
+    parser.add_argument("--ovmf-code", required=True)
+    parser.add_argument("--ovmf-vars", required=True)
+    parser.add_argument("--runs", type=int, default=20)
+    parser.add_argument("--timeout", type=float, default=30.0)
+    parser.add_argument("--base", type=lambda v: int(v, 0), default=0x1000000,
+                        help="kernel load address, page aligned")
+    parser.add_argument("--sizes", type=int_list, default=[4096, 32768, 61440])
+    parser.add_argument("--segments", type=int_list, default=[1, 4, 8])
+    parser.add_argument("--bss", type=int_list, default=[0, 65536])
+    parser.add_argument("--qemu-arg", action="append", default=[],
+                        help="extra QEMU argument, e.g. --qemu-arg=-enable-kvm")
+    parser.add_argument("--output", help="JSON file, default <out-dir>/results.json")
+    args = parser.parse_args()
+
+    for tool in (args.qemu, "mformat", "mmd", "mcopy"):
+        if shutil.which(tool) is None:
+            sys.exit("bench: %s not found" % tool)
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    results = []
+
+    for size in args.sizes:
+        for nsegs in args.segments:
+            for bss in args.bss:
+                name = "size%d_seg%d_bss%d" % (size, nsegs, bss)
+                kernel, span = make_kernel(args.base, size, nsegs, bss)
+                if len(kernel) > MAX_FILE_SIZE or span > MAX_IMAGE_SIZE:
+                    print("bench: skip %s, exceeds loader limits" % name, file=sys.stderr)
+                    continue
+
+                kernel_path = os.path.join(args.out_dir, name + ".o")
+                esp_path = os.path.join(args.out_dir, name + ".img")
+                vars_path = os.path.join(args.out_dir, name + ".vars")
+                with open(kernel_path, "wb") as f:
+                    f.write(kernel)
+                make_esp(esp_path, args.app, kernel_path)
+
+                samples = []
+                totals = []
+                failures = 0
+                for _ in range(args.runs):
+                    # fresh variable store so KernelBoot from a previous run does not leak in
+                    shutil.copyfile(args.ovmf_vars, vars_path)
+                    elapsed = boot_once(args, esp_path, vars_path)
+                    if elapsed is None:
+                        failures += 1
+                    else:
+                        samples.append(elapsed[0])
+                        totals.append(elapsed[1])
+
+                entry = {
+                    "name": name,
+                    "file_size": len(kernel),
+                    "segments": nsegs,
+                    "bss_size": bss,
+                    "failures": failures,
+                    "time_to_entry": summarize(samples),
+                    "total": summarize(totals),
+                }
+                results.append(entry)
+                print("bench: %s p50=%s failures=%d" % (name, entry["time_to_entry"].get("p50_ms"), failures),
+                      file=sys.stderr)
+
+    report = {
+        "qemu": args.qemu,
+        "ovmf_code": args.ovmf_code,
+        "runs": args.runs,
+        "results": results,
+    }
+    output = args.output or os.path.join(args.out_dir, "results.json")
+    with open(output, "w") as f:
+        json.dump(report, f, indent=2)
+    print(output)
+
+
+if __name__ == "__main__":
+    main()